@@ -16,6 +16,7 @@ int main(int argc, char **argv) {
         ("s,radiuses", "Comma separated list of radius values to generate and stack", cxxopts::value<std::string>()->default_value("0.56"))
         ("r,resolution", "Resolution of output GeoTIFF DEM", cxxopts::value<double>()->default_value("0.1"))
         ("x,max-tiles", "Maximum number of tiles to generate (as safety precaution for OOM issues)", cxxopts::value<int>()->default_value("0"))
+        ("overview", "Render an overview DEM at this multiple of the resolution before the full resolution tiles (0 to disable)", cxxopts::value<int>()->default_value("0"))
         ("u,outdir", "Directory to store results", cxxopts::value<std::string>()->default_value("output"))
         
         ("f,force", "Overwrite existing results")
@@ -49,9 +50,10 @@ int main(int argc, char **argv) {
         const auto resolution = result["resolution"].as<double>();
         const bool force = result.count("force");
         const auto maxTiles = result["max-tiles"].as<int>();
+        const auto overviewFactor = result["overview"].as<int>();
 
         auto *pset = readPointSet(inputFilename, classification, decimation);
-        render(pset, outDir, outputType, tileSize, radiuses, resolution, maxTiles, force);
+        render(pset, outDir, outputType, tileSize, radiuses, resolution, maxTiles, force, overviewFactor);
     }
     catch (std::exception &e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -1,42 +1,143 @@
 #include <random>
 #include <filesystem>
+#include <cstring>
+#include <sstream>
 #include "point_io.hpp"
 
 namespace fs = std::filesystem;
 
-std::string getVertexLine(std::ifstream &reader) {
+static std::string readHeaderLine(std::ifstream &reader) {
     std::string line;
+    if (!std::getline(reader, line))
+        throw std::runtime_error("Invalid PLY file (unexpected end of header)");
 
-    // Skip comments
-    do {
-        std::getline(reader, line);
-
-        if (line.find("element") == 0)
-            return line;
-        else if (line.find("comment") == 0)
-            continue;
-        else
-            throw std::runtime_error("Invalid PLY file");
-    } while (true);
+    line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+    return line;
 }
 
-size_t getVertexCount(const std::string &line) {
-
-    // Split line into tokens
+static std::vector<std::string> tokenize(const std::string &line) {
     std::vector<std::string> tokens;
-
     std::istringstream iss(line);
     std::string token;
-    while (std::getline(iss, token, ' '))
+    while (iss >> token)
         tokens.push_back(token);
+    return tokens;
+}
+
+static PlyType parsePlyType(const std::string &type) {
+    if (type == "char" || type == "int8") return PlyType::Int8;
+    if (type == "uchar" || type == "uint8") return PlyType::UInt8;
+    if (type == "short" || type == "int16") return PlyType::Int16;
+    if (type == "ushort" || type == "uint16") return PlyType::UInt16;
+    if (type == "int" || type == "int32") return PlyType::Int32;
+    if (type == "uint" || type == "uint32") return PlyType::UInt32;
+    if (type == "float" || type == "float32") return PlyType::Float32;
+    if (type == "double" || type == "float64") return PlyType::Float64;
+
+    throw std::runtime_error("Invalid PLY file (unknown property type '" + type + "')");
+}
+
+size_t plyTypeSize(PlyType type) {
+    switch (type) {
+        case PlyType::Int8:
+        case PlyType::UInt8: return 1;
+        case PlyType::Int16:
+        case PlyType::UInt16: return 2;
+        case PlyType::Int32:
+        case PlyType::UInt32:
+        case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+    }
+    return 0;
+}
+
+int PlyElement::findProperty(const std::string &name) const {
+    for (size_t i = 0; i < properties.size(); i++) {
+        if (properties[i].name == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+PlySchema readPlyHeader(std::ifstream &reader) {
+    PlySchema schema;
+
+    if (readHeaderLine(reader) != "ply")
+        throw std::runtime_error("Invalid PLY file (header does not start with ply)");
+
+    const auto format = tokenize(readHeaderLine(reader));
+    if (format.size() < 3 || format[0] != "format")
+        throw std::runtime_error("Invalid PLY file (missing format line)");
+
+    if (format[1] == "ascii") schema.format = PlyFormat::Ascii;
+    else if (format[1] == "binary_little_endian") schema.format = PlyFormat::BinaryLittleEndian;
+    else if (format[1] == "binary_big_endian") schema.format = PlyFormat::BinaryBigEndian;
+    else throw std::runtime_error("Invalid PLY file (unknown format '" + format[1] + "')");
+
+    while (true) {
+        const std::string line = readHeaderLine(reader);
+        const auto tokens = tokenize(line);
+
+        if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info") continue;
+        if (tokens[0] == "end_header") break;
+
+        if (tokens[0] == "element" && tokens.size() == 3) {
+            PlyElement e;
+            e.name = tokens[1];
+            e.count = std::stoull(tokens[2]);
+            schema.elements.push_back(e);
+        }
+        else if (tokens[0] == "property" && !schema.elements.empty()) {
+            PlyProperty p;
+            if (tokens.size() == 5 && tokens[1] == "list") {
+                p.isList = true;
+                p.countType = parsePlyType(tokens[2]);
+                p.type = parsePlyType(tokens[3]);
+                p.name = tokens[4];
+            }
+            else if (tokens.size() == 3) {
+                p.type = parsePlyType(tokens[1]);
+                p.name = tokens[2];
+            }
+            else throw std::runtime_error("Invalid PLY file (malformed property '" + line + "')");
+
+            schema.elements.back().properties.push_back(p);
+        }
+        else throw std::runtime_error("Invalid PLY file (unexpected header line '" + line + "')");
+    }
+
+    // Compute record layouts
+    for (size_t i = 0; i < schema.elements.size(); i++) {
+        PlyElement &e = schema.elements[i];
+        size_t offset = 0;
+        bool fixed = true;
+
+        for (auto &p : e.properties) {
+            p.offset = offset;
+            if (p.isList) fixed = false;
+            else offset += plyTypeSize(p.type);
+        }
+        e.stride = fixed ? offset : 0;
+
+        if (e.name == "vertex" && schema.vertex == -1) schema.vertex = static_cast<int>(i);
+    }
+
+    if (schema.vertex == -1)
+        throw std::runtime_error("Invalid PLY file (no vertex element)");
 
-    if (tokens.size() < 3)
-        throw std::runtime_error("Invalid PLY file");
+    const PlyElement &vertex = schema.elements[schema.vertex];
+    schema.x = vertex.findProperty("x");
+    schema.y = vertex.findProperty("y");
+    schema.z = vertex.findProperty("z");
 
-    if (tokens[0] != "element" && tokens[1] != "vertex")
-        throw std::runtime_error("Invalid PLY file");
+    if (schema.x == -1 || schema.y == -1 || schema.z == -1)
+        throw std::runtime_error("Invalid PLY file (vertex element is missing x, y or z)");
 
-    return std::stoi(tokens[2]);
+    for (const int idx : { schema.x, schema.y, schema.z }) {
+        if (vertex.properties[idx].isList)
+            throw std::runtime_error("Invalid PLY file (" + vertex.properties[idx].name + " cannot be a list)");
+    }
+
+    return schema;
 }
 
 PointSet *readPointSet(const std::string &filename, int classification, int decimation) {
@@ -58,141 +159,208 @@ PointSet *readPointSet(const std::string &filename, int classification, int deci
     return r;
 }
 
-PointSet *fastPlyReadPointSet(const std::string &filename, size_t decimation) {
-    std::ifstream reader(filename, std::ios::binary);
-    if (!reader.is_open())
-        throw std::runtime_error("Cannot open file " + filename);
+static bool isLittleEndian() {
+    const uint16_t v = 1;
+    return *reinterpret_cast<const uint8_t *>(&v) == 1;
+}
 
-    auto *r = new PointSet();
+template <typename T>
+static inline double readAs(const char *p) {
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return static_cast<double>(v);
+}
 
-    std::string line;
-    std::getline(reader, line);
-    line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+static inline double readPlyValue(const char *p, PlyType type, bool swap) {
+    char b[8];
+    const size_t n = plyTypeSize(type);
+    std::memcpy(b, p, n);
+    if (swap) std::reverse(b, b + n);
+
+    switch (type) {
+        case PlyType::Int8: return readAs<int8_t>(b);
+        case PlyType::UInt8: return readAs<uint8_t>(b);
+        case PlyType::Int16: return readAs<int16_t>(b);
+        case PlyType::UInt16: return readAs<uint16_t>(b);
+        case PlyType::Int32: return readAs<int32_t>(b);
+        case PlyType::UInt32: return readAs<uint32_t>(b);
+        case PlyType::Float32: return readAs<float>(b);
+        case PlyType::Float64: return readAs<double>(b);
+    }
+    return 0.0;
+}
 
-    if (line != "ply")
-        throw std::runtime_error("Invalid PLY file (header does not start with ply)");
+// Decodes n binary vertex records from buf into r (starting at r[i]).
+// first is the index of the first record in the file, used for decimation
+typedef void (*PlyDecoder)(const char *buf, size_t n, size_t first, size_t decimation,
+                           const PlySchema &schema, bool swap, PointSet *r, size_t &i);
+
+// Native endian records starting with x, y, z of type T, with a compile
+// time stride so that the loop has no per-property branches
+template <typename T, size_t Stride>
+static void decodeFixed(const char *buf, size_t n, size_t first, size_t decimation,
+                        const PlySchema &, bool, PointSet *r, size_t &i) {
+    T xyz[3];
+    for (size_t k = 0; k < n; k++) {
+        if (decimation > 1 && (first + k) % decimation == 0) continue;
+
+        std::memcpy(xyz, buf + k * Stride, sizeof(xyz));
+        r->x[i] = static_cast<double>(xyz[0]);
+        r->y[i] = static_cast<double>(xyz[1]);
+        r->z[i] = static_cast<double>(xyz[2]);
+        r->extent.update(r->x[i], r->y[i]);
 
-    std::getline(reader, line);
-    line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+        i++;
+    }
+}
 
-    // We are reading an ascii ply
-    bool ascii = line == "format ascii 1.0";
+// Any other layout (arbitrary property order, types and endianness)
+static void decodeGeneric(const char *buf, size_t n, size_t first, size_t decimation,
+                          const PlySchema &schema, bool swap, PointSet *r, size_t &i) {
+    const PlyElement &vertex = schema.elements[schema.vertex];
+    const PlyProperty &px = vertex.properties[schema.x];
+    const PlyProperty &py = vertex.properties[schema.y];
+    const PlyProperty &pz = vertex.properties[schema.z];
+    const size_t stride = vertex.stride;
+
+    for (size_t k = 0; k < n; k++) {
+        if (decimation > 1 && (first + k) % decimation == 0) continue;
+
+        const char *rec = buf + k * stride;
+        r->x[i] = readPlyValue(rec + px.offset, px.type, swap);
+        r->y[i] = readPlyValue(rec + py.offset, py.type, swap);
+        r->z[i] = readPlyValue(rec + pz.offset, pz.type, swap);
+        r->extent.update(r->x[i], r->y[i]);
 
-    const auto vertexLine = getVertexLine(reader);
-    const auto count = getVertexCount(vertexLine);
+        i++;
+    }
+}
 
-    std::cout << "Reading " << count << " points" << std::endl;
+// Size of a record with x, y, z (T) followed by the optional attributes
+// found in ODM point clouds: normals (N), colors, segmentation, views
+template <typename T, typename N = float>
+static constexpr size_t plyRecordSize(bool normals, bool colors, bool segmentation, bool views) {
+    return 3 * sizeof(T) +
+           (normals ? 3 * sizeof(N) : 0) +
+           (colors ? 3 * sizeof(uint8_t) : 0) +
+           (segmentation ? sizeof(uint8_t) + sizeof(float) : 0) +
+           (views ? sizeof(uint8_t) : 0);
+}
+
+template <typename T>
+static bool isLeadingXYZ(const PlySchema &schema, PlyType type) {
+    const PlyElement &vertex = schema.elements[schema.vertex];
+    const PlyProperty &px = vertex.properties[schema.x];
+    const PlyProperty &py = vertex.properties[schema.y];
+    const PlyProperty &pz = vertex.properties[schema.z];
 
-    checkHeader(reader, "x");
-    checkHeader(reader, "y");
-    checkHeader(reader, "z");
+    return px.type == type && py.type == type && pz.type == type &&
+           px.offset == 0 && py.offset == sizeof(T) && pz.offset == 2 * sizeof(T);
+}
 
-    int c = 0;
-    bool hasViews = false;
-    bool hasNormals = false;
-    bool hasColors = false;
-    bool hasSegmentation = false;
-    bool decimate = decimation > 1;
+static PlyDecoder getPlyDecoder(const PlySchema &schema, bool swap) {
+    if (swap) return decodeGeneric;
 
-    std::getline(reader, line);
-    line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+    const size_t stride = schema.elements[schema.vertex].stride;
 
-    while (line != "end_header") {
-        if (hasHeader(line, "nx") || hasHeader(line, "normal_x") || hasHeader(line, "normalx")) hasNormals = true;
-        if (hasHeader(line, "red") || hasHeader(line, "green") || hasHeader(line, "blue")) hasColors = true;
-        if (hasHeader(line, "views")) hasViews = true;
-        if (hasHeader(line, "segmentation")) hasSegmentation = true;
-        
-        if (c++ > 100) break;
-        std::getline(reader, line);
-        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+    if (isLeadingXYZ<float>(schema, PlyType::Float32)) {
+        switch (stride) {
+            case plyRecordSize<float>(false, false, false, false): return decodeFixed<float, plyRecordSize<float>(false, false, false, false)>;
+            case plyRecordSize<float>(false, true, false, false): return decodeFixed<float, plyRecordSize<float>(false, true, false, false)>;
+            case plyRecordSize<float>(true, false, false, false): return decodeFixed<float, plyRecordSize<float>(true, false, false, false)>;
+            case plyRecordSize<float>(true, true, false, false): return decodeFixed<float, plyRecordSize<float>(true, true, false, false)>;
+            case plyRecordSize<float>(true, true, false, true): return decodeFixed<float, plyRecordSize<float>(true, true, false, true)>;
+            case plyRecordSize<float>(true, true, true, false): return decodeFixed<float, plyRecordSize<float>(true, true, true, false)>;
+            case plyRecordSize<float>(true, true, true, true): return decodeFixed<float, plyRecordSize<float>(true, true, true, true)>;
+        }
+    }
+    else if (isLeadingXYZ<double>(schema, PlyType::Float64)) {
+        switch (stride) {
+            case plyRecordSize<double>(false, false, false, false): return decodeFixed<double, plyRecordSize<double>(false, false, false, false)>;
+            case plyRecordSize<double>(false, true, false, false): return decodeFixed<double, plyRecordSize<double>(false, true, false, false)>;
+            case plyRecordSize<double>(true, false, false, false): return decodeFixed<double, plyRecordSize<double>(true, false, false, false)>;
+            case plyRecordSize<double>(true, true, false, false): return decodeFixed<double, plyRecordSize<double>(true, true, false, false)>;
+            case plyRecordSize<double>(true, true, false, true): return decodeFixed<double, plyRecordSize<double>(true, true, false, true)>;
+            case plyRecordSize<double>(true, true, true, false): return decodeFixed<double, plyRecordSize<double>(true, true, true, false)>;
+            case plyRecordSize<double>(true, true, true, true): return decodeFixed<double, plyRecordSize<double>(true, true, true, true)>;
+            case plyRecordSize<double, double>(true, false, false, false): return decodeFixed<double, plyRecordSize<double, double>(true, false, false, false)>;
+            case plyRecordSize<double, double>(true, true, false, false): return decodeFixed<double, plyRecordSize<double, double>(true, true, false, false)>;
+        }
     }
 
-    r->resize(count / decimation);
+    return decodeGeneric;
+}
 
-    // Read points
-    if (ascii) {
-        uint16_t buf;
-        float fbuf;
-        size_t i = 0;
+PointSet *fastPlyReadPointSet(const std::string &filename, size_t decimation) {
+    std::ifstream reader(filename, std::ios::binary);
+    if (!reader.is_open())
+        throw std::runtime_error("Cannot open file " + filename);
 
-        for (size_t idx = 0; idx < count; idx++) {
-            if (decimate && idx % decimation == 0) continue;
-
-            reader >> r->x[i]
-                >> r->y[i]
-                >> r->z[i];
-            if (hasNormals) {
-                reader >> fbuf
-                    >> fbuf
-                    >> fbuf;
-            }
-            if (hasColors) {
-                reader >> buf >> buf >> buf;
-            }
-            if (hasSegmentation) {
-                reader >> buf >> buf;
-            }
-            if (hasViews) {
-                reader >> buf;
-            }
+    const PlySchema schema = readPlyHeader(reader);
+    const PlyElement &vertex = schema.elements[schema.vertex];
+    const size_t count = vertex.count;
+    const bool ascii = schema.format == PlyFormat::Ascii;
 
-            r->extent.update(r->x[i], r->y[i]);
+    if (vertex.stride == 0)
+        throw std::runtime_error("Unsupported PLY file (list properties in vertex element)");
 
-            i++;
+    std::cout << "Reading " << count << " points" << std::endl;
+
+    // Skip elements that come before the vertices
+    for (int e = 0; e < schema.vertex; e++) {
+        const PlyElement &el = schema.elements[e];
+        if (ascii) {
+            std::string line;
+            for (size_t j = 0; j < el.count; j++) std::getline(reader, line);
+        }
+        else {
+            if (el.stride == 0)
+                throw std::runtime_error("Unsupported PLY file (list properties in element '" + el.name + "' before vertices)");
+            reader.seekg(static_cast<std::streamoff>(el.stride * el.count), std::ios::cur);
         }
     }
-    else {
 
-        // Read points
-        uint8_t color[3];
-        uint8_t segmentation;
-        float segmentationConfidence;
-        XYZ buf;
-        size_t i = 0;
-
-        for (size_t idx = 0; idx < count; idx++) {
-            if (decimate && idx % decimation == 0) continue;
-
-            reader.read(reinterpret_cast<char *>(&buf), sizeof(float) * 3);
-            r->x[i] = static_cast<double>(buf.x);
-            r->y[i] = static_cast<double>(buf.y);
-            r->z[i] = static_cast<double>(buf.z);
-            
-            if (hasNormals) {
-                reader.read(reinterpret_cast<char *>(&buf), sizeof(float) * 3);
-            }
-
-            if (hasColors) {
-                reader.read(reinterpret_cast<char *>(&color), sizeof(uint8_t) * 3);
-            }
+    auto *r = new PointSet();
+    const size_t skipped = decimation > 1 ? (count + decimation - 1) / decimation : 0;
+    r->resize(count - skipped);
+    size_t i = 0;
 
-            if (hasSegmentation) {
-                reader.read(reinterpret_cast<char *>(&segmentation), sizeof(uint8_t));
-                reader.read(reinterpret_cast<char *>(&segmentationConfidence), sizeof(float));
-            }
+    // Read points
+    if (ascii) {
+        const size_t numProps = vertex.properties.size();
+        std::vector<double> values(numProps);
 
-            if (hasViews) {
-                reader.read(reinterpret_cast<char *>(&color[0]), sizeof(uint8_t));
-            }
+        for (size_t idx = 0; idx < count; idx++) {
+            for (size_t p = 0; p < numProps; p++) reader >> values[p];
+            if (!reader) throw std::runtime_error("Invalid PLY file (unexpected end of file)");
+            if (decimation > 1 && idx % decimation == 0) continue;
 
+            r->x[i] = values[schema.x];
+            r->y[i] = values[schema.y];
+            r->z[i] = values[schema.z];
             r->extent.update(r->x[i], r->y[i]);
 
             i++;
         }
     }
+    else {
+        const bool swap = (schema.format == PlyFormat::BinaryLittleEndian) != isLittleEndian();
+        const PlyDecoder decode = getPlyDecoder(schema, swap);
 
-    // for (size_t idx = 0; idx < count; idx++) {
-    //     std::cout << r->points[idx][0] << " ";
-    //     std::cout << r->points[idx][1] << " ";
-    //     std::cout << r->points[idx][2] << " ";
+        const size_t CHUNK_SIZE = 65536;
+        std::vector<char> buf(CHUNK_SIZE * vertex.stride);
 
-    //     std::cout << std::endl;
+        for (size_t first = 0; first < count; first += CHUNK_SIZE) {
+            const size_t n = (std::min)(CHUNK_SIZE, count - first);
+            const size_t bytes = n * vertex.stride;
 
-    //     if (idx > 9) exit(1);
-    // }
+            reader.read(buf.data(), static_cast<std::streamsize>(bytes));
+            if (static_cast<size_t>(reader.gcount()) != bytes)
+                throw std::runtime_error("Invalid PLY file (unexpected end of file)");
 
-    // exit(1);
+            decode(buf.data(), n, first, decimation, schema, swap, r, i);
+        }
+    }
 
     reader.close();
 
@@ -249,7 +417,8 @@ PointSet *pdalReadPointSet(const std::string &filename, uint8_t onlyClass, size_
         classId = layout->findDim(classDimension);
     }
 
-    r->resize(count / decimation);
+    // Upper bound, trimmed to the number of points actually kept below
+    r->resize(count);
     if (!hasClass && onlyClass != 255) throw std::runtime_error("Cannot filter by classification (no classification dimension found)");
     bool filter = hasClass && onlyClass != 255;
 
@@ -288,21 +457,6 @@ PointSet *pdalReadPointSet(const std::string &filename, uint8_t onlyClass, size_
     return r;
 }
 
-void checkHeader(std::ifstream &reader, const std::string &prop) {
-    std::string line;
-    std::getline(reader, line);
-    line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
-
-    if (line.substr(line.length() - prop.length(), prop.length()) != prop) {
-        throw std::runtime_error("Invalid PLY file (expected 'property * " + prop + "', but found '" + line + "')");
-    }
-}
-
-bool hasHeader(const std::string &line, const std::string &prop) {
-    //std::cout << line << " -> " << prop << " : " << line.substr(line.length() - prop.length(), prop.length()) << std::endl;
-    return line.substr(0, 8) == "property" && line.substr(line.length() - prop.length(), prop.length()) == prop;
-}
-
 bool fileExists(const std::string &path) {
     std::ifstream fin(path);
     const bool e = fin.good();
@@ -12,12 +12,6 @@
 #include <pdal/StageFactory.hpp>
 #include <pdal/io/BufferReader.hpp>
 
-struct XYZ {
-    float x;
-    float y;
-    float z;
-};
-
 struct Extent{
     double minx;
     double maxx;
@@ -26,7 +20,7 @@ struct Extent{
 
     Extent(){
         minx = miny = (std::numeric_limits<double>::max)();
-        maxx = maxy = (std::numeric_limits<double>::min)();
+        maxx = maxy = (std::numeric_limits<double>::lowest)();
     }
 
     void inline update(double x, double y){
@@ -54,6 +48,43 @@ struct Extent{
 };
 
 
+// Non-owning view over caller-provided coordinates. Each axis can live in
+// its own array or be interleaved in a larger record.
+struct PointSpan {
+    const double *x = nullptr;
+    const double *y = nullptr;
+    const double *z = nullptr;
+    size_t count = 0;
+
+    // In bytes, 0 means tightly packed doubles
+    size_t xStride = sizeof(double);
+    size_t yStride = sizeof(double);
+    size_t zStride = sizeof(double);
+
+    // Computed from the points if left unset (see hasExtent)
+    Extent extent;
+    pdal::SpatialReference srs;
+
+    inline size_t size() const { return count; }
+
+    inline double getX(size_t i) const { return at(x, xStride, i); }
+    inline double getY(size_t i) const { return at(y, yStride, i); }
+    inline double getZ(size_t i) const { return at(z, zStride, i); }
+
+    inline bool hasExtent() const { return extent.minx <= extent.maxx && extent.miny <= extent.maxy; }
+    void computeExtent(){
+        extent = Extent();
+        for (size_t i = 0; i < count; i++){
+            extent.update(getX(i), getY(i));
+        }
+    }
+
+private:
+    static inline double at(const double *base, size_t stride, size_t i){
+        return *reinterpret_cast<const double *>(reinterpret_cast<const char *>(base) + i * stride);
+    }
+};
+
 struct PointSet {
     std::vector<double> x;
     std::vector<double> y;
@@ -75,12 +106,57 @@ struct PointSet {
 
     Extent extent;
     pdal::SpatialReference srs;
+
+    PointSpan span() const {
+        PointSpan s;
+        s.x = x.data();
+        s.y = y.data();
+        s.z = z.data();
+        s.count = x.size();
+        s.extent = extent;
+        s.srs = srs;
+        return s;
+    }
+};
+
+enum class PlyFormat { Ascii, BinaryLittleEndian, BinaryBigEndian };
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    bool isList = false;
+    PlyType countType; // Only meaningful for list properties
+
+    // Byte offset within the record (binary, fixed size records only)
+    size_t offset = 0;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+
+    // Size in bytes of one binary record (0 if it contains lists)
+    size_t stride = 0;
+
+    int findProperty(const std::string &name) const;
+};
+
+struct PlySchema {
+    PlyFormat format;
+    std::vector<PlyElement> elements;
+
+    // Index into elements
+    int vertex = -1;
+    // Index into elements[vertex].properties
+    int x = -1;
+    int y = -1;
+    int z = -1;
 };
 
-std::string getVertexLine(std::ifstream &reader);
-size_t getVertexCount(const std::string &line);
-inline void checkHeader(std::ifstream &reader, const std::string &prop);
-inline bool hasHeader(const std::string &line, const std::string &prop);
+size_t plyTypeSize(PlyType type);
+PlySchema readPlyHeader(std::ifstream &reader);
 
 PointSet *fastPlyReadPointSet(const std::string &filename, size_t decimation = 1);
 PointSet *pdalReadPointSet(const std::string &filename, uint8_t onlyClass = 255, size_t decimation = 1);
@@ -2,6 +2,7 @@
 #include <cmath>
 #include <algorithm>
 #include <array>
+#include <exception>
 #include "pdal/io/private/GDALGrid.hpp"
 #include "pdal/private/gdal/Raster.hpp"
 #include "render.hpp"
@@ -11,27 +12,135 @@ namespace fs = std::filesystem;
 
 struct Tile{
     double radius;
+    unsigned int x;
+    unsigned int y;
     Extent bounds;
     Extent bufferedBounds;
     std::string filename;
 };
 
-void render(PointSet *pset, const std::string &outDir, const std::string &outputType,
-        int tileSize, 
-        const std::vector<double> &radiuses, double resolution, 
-        int maxTiles, bool force){
-    fs::path pOutDir = fs::path(outDir);
-    std::vector<double> rads(radiuses);
+static void writeRaster(const RasterTile &t, const pdal::SpatialReference &srs, const std::string &outputType){
+    pdal::gdal::Raster raster(t.filename, "GTiff", srs, t.geoTransform);
+    pdal::StringList options;
+    double srcNoData = std::numeric_limits<double>::quiet_NaN();
+
+    pdal::gdal::GDALError err = raster.open(t.width, t.height,
+        1, pdal::Dimension::Type::Float, -9999, options);
+
+    if (err != pdal::gdal::GDALError::None) throw std::runtime_error(raster.errorMsg());
+    
+    err = raster.writeBand(const_cast<double *>(t.data), srcNoData, 1, outputType);
+    if (err != pdal::gdal::GDALError::None) throw std::runtime_error(raster.errorMsg());
+    raster.close();
+}
+
+// Number of cells of an overview grid covering extent
+static size_t overviewPixelCount(const Extent &extent, double resolution){
+    return static_cast<size_t>(std::floor(extent.width() / resolution) + 1) *
+           static_cast<size_t>(std::floor(extent.height() / resolution) + 1);
+}
+
+// Bins all points into a single grid covering the extent, keeping the
+// max (or mean, for idw) elevation per cell. One pass, no search radius,
+// so it's much cheaper than the full render and useful as a quick preview
+static void renderOverview(const PointSpan &points, const Extent &extent,
+        double resolution, const std::string &outputType,
+        const std::string &filename, const TileCallback &onTile){
+    const int width = static_cast<int>(std::floor(extent.width() / resolution) + 1);
+    const int height = static_cast<int>(std::floor(extent.height() / resolution) + 1);
+    const size_t pxCount = static_cast<size_t>(width) * static_cast<size_t>(height);
+    const bool mean = outputType != "max";
+
+    std::vector<double> data(pxCount, std::numeric_limits<double>::quiet_NaN());
+    std::vector<uint32_t> counts;
+    if (mean) counts.resize(pxCount, 0);
+
+    for (size_t i = 0; i < points.size(); i++){
+        const double x = points.getX(i);
+        const double y = points.getY(i);
+        const double z = points.getZ(i);
+
+        const double col = std::floor((x - extent.minx) / resolution);
+        const double row = height - 1 - std::floor((y - extent.miny) / resolution);
+        if (col < 0 || col >= width || row < 0 || row >= height) continue;
+
+        const size_t idx = static_cast<size_t>(row) * width + static_cast<size_t>(col);
+        if (mean){
+            data[idx] = counts[idx] == 0 ? z : data[idx] + z;
+            counts[idx]++;
+        }else if (std::isnan(data[idx]) || z > data[idx]){
+            data[idx] = z;
+        }
+    }
 
-    if (fs::exists(pOutDir)){
-        if (!force) throw std::runtime_error(outDir + " exists (use --force to overwrite results)");
+    if (mean){
+        for (size_t i = 0; i < pxCount; i++){
+            if (counts[i] > 0) data[i] /= counts[i];
+        }
+    }
+
+    RasterTile rt;
+    rt.overview = true;
+    rt.radius = 0;
+    rt.x = 0;
+    rt.y = 0;
+    rt.width = width;
+    rt.height = height;
+    rt.filename = filename;
+
+    rt.geoTransform[0] = extent.minx;
+    rt.geoTransform[1] = resolution;
+    rt.geoTransform[2] = 0;
+    rt.geoTransform[3] = extent.miny + (resolution * height);
+    rt.geoTransform[4] = 0;
+    rt.geoTransform[5] = -resolution;
+
+    rt.data = data.data();
+    rt.empty = false;
+
+    if (!filename.empty()) writeRaster(rt, points.srs, outputType);
+    if (onTile) onTile(rt);
+}
+
+void render(const PointSpan &input, const RenderOptions &opts,
+        const TileCallback &onTile,
+        const ProgressCallback &onProgress){
+    PointSpan points = input;
+    if (points.xStride == 0) points.xStride = sizeof(double);
+    if (points.yStride == 0) points.yStride = sizeof(double);
+    if (points.zStride == 0) points.zStride = sizeof(double);
+
+    const bool writeFiles = !opts.outDir.empty();
+    fs::path pOutDir = fs::path(opts.outDir);
+    std::vector<double> rads(opts.radiuses);
+    double resolution = opts.resolution;
+    const int tileSize = opts.tileSize;
+    const std::string &outputType = opts.outputType;
+    int overviewFactor = opts.overviewFactor;
+
+    if (points.size() == 0) throw std::runtime_error("No points to render");
+    if (points.x == nullptr || points.y == nullptr || points.z == nullptr) throw std::runtime_error("x, y and z buffers are required");
+    if (rads.empty()) throw std::runtime_error("At least one radius is required");
+    if (resolution <= 0) throw std::runtime_error("Resolution must be > 0");
+    if (tileSize <= 0) throw std::runtime_error("Tile size must be > 0");
+    if (overviewFactor < 0 || overviewFactor == 1) throw std::runtime_error("Overview factor must be > 1 (or 0 to disable)");
+
+    int outputTypes;
+    if (outputType == "max"){
+        outputTypes = pdal::GDALGrid::statMax;
+    }else if (outputType == "idw"){
+        outputTypes = pdal::GDALGrid::statIdw;
     }else{
-        fs::create_directories(pOutDir);
+        throw std::runtime_error("Unsupported output-type: " + outputType);
     }
 
+    if (!points.hasExtent()) points.computeExtent();
+    if (!points.hasExtent()) throw std::runtime_error("Invalid point cloud extent (are the coordinates finite?)");
+    const Extent extent = points.extent;
+
     // Generate tile list
-    unsigned int width = static_cast<int>(std::ceil(pset->extent.width() / resolution));
-    unsigned int height = static_cast<int>(std::ceil(pset->extent.height() / resolution));
+    unsigned int width = static_cast<int>(std::ceil(extent.width() / resolution));
+    unsigned int height = static_cast<int>(std::ceil(extent.height() / resolution));
     
     // Set a floor, no matter the resolution parameter
     // (sometimes a wrongly estimated scale of the model can cause the resolution
@@ -44,9 +153,9 @@ void render(PointSet *pset, const std::string &outDir, const std::string &output
         
         if (width >= height){
             width = RES_FLOOR;
-            height = static_cast<unsigned int>(std::ceil(pset->extent.height() / pset->extent.width() * RES_FLOOR));
+            height = static_cast<unsigned int>(std::ceil(extent.height() / extent.width() * RES_FLOOR));
         } else {
-            width = static_cast<unsigned int>(std::ceil(pset->extent.width() / pset->extent.height() * RES_FLOOR));
+            width = static_cast<unsigned int>(std::ceil(extent.width() / extent.height() * RES_FLOOR));
             height = RES_FLOOR;
         }
 
@@ -57,7 +166,7 @@ void render(PointSet *pset, const std::string &outDir, const std::string &output
             rads[i] *= floor_ratio;
         }
 
-        std::cout << "Really low resolution DEM requested (" << prev_width << ", " << prev_height << ") will set floor at " << RES_FLOOR << " pixels. Resolution changed to " << resolution << ". The scale of this reconstruction might be off." << std::endl;
+        if (opts.verbose) std::cout << "Really low resolution DEM requested (" << prev_width << ", " << prev_height << ") will set floor at " << RES_FLOOR << " pixels. Resolution changed to " << resolution << ". The scale of this reconstruction might be off." << std::endl;
     }
 
     unsigned int numSplitsX = static_cast<int>(std::max<double>(1.0, std::ceil(width / static_cast<double>(tileSize))));
@@ -65,17 +174,41 @@ void render(PointSet *pset, const std::string &outDir, const std::string &output
     
     unsigned int numTiles = numSplitsX * numSplitsY;
 
-    std::cout << "DEM resolution is (" << width << ", " << height << "), max tile size is " << tileSize << ", will split DEM generation into " << numTiles << " tiles" << std::endl;
+    if (opts.verbose) std::cout << "DEM resolution is (" << width << ", " << height << "), max tile size is " << tileSize << ", will split DEM generation into " << numTiles << " tiles" << std::endl;
+
+    if (opts.maxTiles > 0){
+        if (numTiles > static_cast<unsigned int>(opts.maxTiles)){
+            throw std::runtime_error("Max tiles limit exceeded (" + std::to_string(opts.maxTiles) + "). This is a strong indicator that the reconstruction failed");
+        }
+    }
+
+    // The overview is a single grid, so cap it to the size of one tile
+    // (the same memory each worker already uses for the full render)
+    if (overviewFactor > 1){
+        const size_t maxOverviewPixels = static_cast<size_t>(tileSize) * static_cast<size_t>(tileSize);
+        if (overviewPixelCount(extent, resolution * overviewFactor) > maxOverviewPixels){
+            const int requested = overviewFactor;
 
-    if (maxTiles > 0){
-        if (numTiles > maxTiles){
-            std::cerr << "Max tiles limit exceeded (" << maxTiles << "). This is a strong indicator that the reconstruction failed" << std::endl;
-            exit(1);
+            // Lower bound, since a grid at factor f has at least 1/f^2 of the full resolution pixels
+            const double fullPixels = static_cast<double>(overviewPixelCount(extent, resolution));
+            overviewFactor = (std::max)(overviewFactor, static_cast<int>(std::floor(std::sqrt(fullPixels) / tileSize)));
+            while (overviewPixelCount(extent, resolution * overviewFactor) > maxOverviewPixels) overviewFactor++;
+
+            if (opts.verbose) std::cout << "Overview factor " << requested << " would exceed the tile size (" << tileSize << "x" << tileSize << " pixels), using " << overviewFactor << " instead" << std::endl;
+        }
+    }
+
+    if (writeFiles){
+        if (fs::exists(pOutDir)){
+            if (!opts.force) throw std::runtime_error(opts.outDir + " exists (use --force to overwrite results)");
+        }else{
+            fs::create_directories(pOutDir);
         }
+        if (overviewFactor > 1) fs::create_directories(pOutDir / "overview");
     }
 
-    double tileBoundsWidth = pset->extent.width() / static_cast<double>(numSplitsX);
-    double tileBoundsHeight = pset->extent.height() / static_cast<double>(numSplitsY);
+    double tileBoundsWidth = extent.width() / static_cast<double>(numSplitsX);
+    double tileBoundsHeight = extent.height() / static_cast<double>(numSplitsY);
 
     std::vector<Tile> tiles;
 
@@ -85,23 +218,26 @@ void render(PointSet *pset, const std::string &outDir, const std::string &output
     double maxy;
 
     for (const double &r: rads){
-        minx = pset->extent.minx;
+        minx = extent.minx;
         for (unsigned int x = 0; x < numSplitsX; x++){
-            miny = pset->extent.miny;
+            miny = extent.miny;
             maxx = x == numSplitsX - 1 ?
-                            pset->extent.maxx : 
+                            extent.maxx : 
                             minx + tileBoundsWidth;
 
             for (unsigned int y = 0; y < numSplitsY; y++){
                 maxy = y == numSplitsY - 1 ? 
-                                pset->extent.maxy : 
+                                extent.maxy : 
                                 miny + tileBoundsHeight;
 
-                std::stringstream ss;
-                ss << "r" << r << "_x" << x << "_y" << y << ".tif"; 
-
                 Tile t;
-                t.filename = (fs::absolute(pOutDir) / ss.str()).string();
+                if (writeFiles){
+                    std::stringstream ss;
+                    ss << "r" << r << "_x" << x << "_y" << y << ".tif"; 
+                    t.filename = (fs::absolute(pOutDir) / ss.str()).string();
+                }
+                t.x = x;
+                t.y = y;
                 t.bounds.minx = minx;
                 t.bounds.maxx = maxx;
                 t.bounds.miny = miny;
@@ -128,77 +264,128 @@ void render(PointSet *pset, const std::string &outDir, const std::string &output
         [](Tile const &a, Tile const &b) {
             return a.radius < b.radius; 
         });
-    
-    int outputTypes;
-    if (outputType == "max"){
-        outputTypes = pdal::GDALGrid::statMax;
-    }else if (outputType == "idw"){
-        outputTypes = pdal::GDALGrid::statIdw;
-    }else{
-        throw std::runtime_error("Unsupported output-type: " + outputType);
-    }
-
-    #pragma omp parallel for
-    for (int i = 0; i < tiles.size(); i++){
-        Tile t = tiles[i];
-        int r_width = static_cast<int>(std::floor(t.bounds.width() / resolution) + 1);
-        int r_height = static_cast<int>(std::floor(t.bounds.height() / resolution) + 1);
 
-        pdal::GDALGrid grid(t.bounds.minx, t.bounds.miny, 
-                            r_width, r_height, 
-                            resolution, t.radius, outputTypes, 0, 1.0);
-        
-        for (size_t i = 0; i < pset->size(); i++){
-            if (pset->x[i] >= t.bufferedBounds.minx && pset->x[i] <= t.bufferedBounds.maxx &&
-                pset->y[i] >= t.bufferedBounds.miny && pset->y[i] <= t.bufferedBounds.maxy){
-                grid.addPoint(pset->x[i], pset->y[i], pset->z[i]);
-            }
-        }
+    size_t done = 0;
+    const size_t total = tiles.size() + (overviewFactor > 1 ? 1 : 0);
 
-        std::array<double, 6> pixelToPos;
+    // The overview goes first, so that callers can inspect
+    // it well before the full resolution tiles are done
+    if (overviewFactor > 1){
+        const double overviewResolution = resolution * overviewFactor;
+        if (opts.verbose) std::cout << "Rendering overview DEM at " << overviewResolution << " resolution" << std::endl;
 
-        pixelToPos[0] = t.bounds.minx;
-        pixelToPos[1] = resolution;
-        pixelToPos[2] = 0;
-        pixelToPos[3] = t.bounds.miny + (resolution * r_height);
-        pixelToPos[4] = 0;
-        pixelToPos[5] = -resolution;
+        const std::string filename = writeFiles ? (fs::absolute(pOutDir) / "overview" / "overview.tif").string() : "";
+        renderOverview(points, extent, overviewResolution, outputType, filename, onTile);
+        
+        done++;
+        if (onProgress) onProgress(done, total);
+    }
 
-        pdal::gdal::Raster raster(t.filename, "GTiff", pset->srs, pixelToPos);
+    std::exception_ptr error = nullptr;
 
-        grid.finalize();
+    // Exceptions cannot propagate out of an OpenMP region,
+    // so we store the first one and rethrow it at the end
+    #pragma omp parallel for
+    for (int i = 0; i < tiles.size(); i++){
+        bool failed;
+        #pragma omp critical
+        failed = error != nullptr;
+        if (failed) continue;
 
-        double *src = grid.data(outputType);
-        double srcNoData = std::numeric_limits<double>::quiet_NaN();
+        try{
+            const Tile &t = tiles[i];
+            int r_width = static_cast<int>(std::floor(t.bounds.width() / resolution) + 1);
+            int r_height = static_cast<int>(std::floor(t.bounds.height() / resolution) + 1);
 
-        // Did we actually write anything, or is this an empty tile?
-        bool empty = true;
-        size_t pxCount = r_width * r_height;
-        for (size_t i = 0; i < pxCount; i++){
-            if (!isnan(src[i])){
-                empty = false;
-                break;
+            pdal::GDALGrid grid(t.bounds.minx, t.bounds.miny, 
+                                r_width, r_height, 
+                                resolution, t.radius, outputTypes, 0, 1.0);
+            
+            for (size_t j = 0; j < points.size(); j++){
+                const double x = points.getX(j);
+                const double y = points.getY(j);
+                if (x >= t.bufferedBounds.minx && x <= t.bufferedBounds.maxx &&
+                    y >= t.bufferedBounds.miny && y <= t.bufferedBounds.maxy){
+                    grid.addPoint(x, y, points.getZ(j));
+                }
             }
-        }
 
-        if (!empty){
-            pdal::StringList options;
-
-            pdal::gdal::GDALError err = raster.open(r_width, r_height,
-                1, pdal::Dimension::Type::Float, -9999, options);
-
-            if (err != pdal::gdal::GDALError::None) throw std::runtime_error(raster.errorMsg());
-            int bandNum = 1;
-            
-            err = raster.writeBand(src, srcNoData, 1, outputType);
-            if (err != pdal::gdal::GDALError::None) throw std::runtime_error(raster.errorMsg());
-            raster.close();
-        }
+            RasterTile rt;
+            rt.overview = false;
+            rt.radius = t.radius;
+            rt.x = t.x;
+            rt.y = t.y;
+            rt.width = r_width;
+            rt.height = r_height;
+            rt.filename = t.filename;
+
+            rt.geoTransform[0] = t.bounds.minx;
+            rt.geoTransform[1] = resolution;
+            rt.geoTransform[2] = 0;
+            rt.geoTransform[3] = t.bounds.miny + (resolution * r_height);
+            rt.geoTransform[4] = 0;
+            rt.geoTransform[5] = -resolution;
+
+            grid.finalize();
+
+            double *src = grid.data(outputType);
+
+            // Did we actually write anything, or is this an empty tile?
+            bool empty = true;
+            size_t pxCount = r_width * r_height;
+            for (size_t j = 0; j < pxCount; j++){
+                if (!std::isnan(src[j])){
+                    empty = false;
+                    break;
+                }
+            }
 
-        #pragma omp critical
-        {
-            std::cout << fs::path(t.filename).filename().string() << (empty ? " [Empty]" : "") << std::endl;
+            rt.data = src;
+            rt.empty = empty;
+
+            if (writeFiles && !empty) writeRaster(rt, points.srs, outputType);
+
+            // Nothing may escape a critical section (it would terminate),
+            // so callback errors are stored here as well
+            #pragma omp critical
+            {
+                if (!error){
+                    try{
+                        done++;
+                        if (onTile) onTile(rt);
+                        if (onProgress) onProgress(done, total);
+                    }catch(...){
+                        error = std::current_exception();
+                    }
+                }
+            }
+        }catch(...){
+            #pragma omp critical
+            {
+                if (!error) error = std::current_exception();
+            }
         }
     }
 
-}
\ No newline at end of file
+    if (error) std::rethrow_exception(error);
+}
+
+void render(PointSet *pset, const std::string &outDir, const std::string &outputType,
+        int tileSize, 
+        const std::vector<double> &radiuses, double resolution, 
+        int maxTiles, bool force, int overviewFactor){
+    RenderOptions opts;
+    opts.outDir = outDir;
+    opts.outputType = outputType;
+    opts.tileSize = tileSize;
+    opts.radiuses = radiuses;
+    opts.resolution = resolution;
+    opts.maxTiles = maxTiles;
+    opts.force = force;
+    opts.overviewFactor = overviewFactor;
+    opts.verbose = true;
+
+    render(pset->span(), opts, [](const RasterTile &t){
+        std::cout << fs::path(t.filename).filename().string() << (t.empty ? " [Empty]" : "") << std::endl;
+    });
+}
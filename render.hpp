@@ -2,13 +2,72 @@
 #define RENDER_H
 
 #include <vector>
+#include <array>
+#include <string>
+#include <functional>
 
 #include "point_io.hpp"
 
+struct RenderOptions{
+    // Directory where GeoTIFF tiles are written. Leave empty to keep
+    // results in memory only (delivered through the tile callback)
+    std::string outDir;
+    std::string outputType = "max";
+    int tileSize = 4096;
+    std::vector<double> radiuses = { 0.56 };
+    double resolution = 0.1;
+    int maxTiles = 0;
+    bool force = false;
+
+    // When > 1, render a coarse overview DEM at overviewFactor * resolution
+    // before the full resolution tiles (max or mean of the points per cell),
+    // written to overview/overview.tif in outDir. The factor is raised if
+    // needed so that the overview has at most tileSize * tileSize pixels
+    int overviewFactor = 0;
+
+    // Print informational messages to stdout
+    bool verbose = false;
+};
+
+struct RasterTile{
+    // Overview DEM covering the whole extent (radius, x and y are 0).
+    // Its origin is the top left corner of the extent, so its pixels are
+    // not aligned with those of the tiles (check geoTransform)
+    bool overview;
+
+    double radius;
+    unsigned int x;
+    unsigned int y;
+    int width;
+    int height;
+
+    // GDAL style geotransform (origin at the top left corner)
+    std::array<double, 6> geoTransform;
+
+    // Row-major (top row first), width * height values, NaN where no data is available.
+    // Only valid for the duration of the tile callback
+    const double *data;
+    bool empty;
+
+    // Target GeoTIFF path, empty when rendering in memory only.
+    // Empty tiles are never written
+    std::string filename;
+};
+
+// Callbacks are never invoked concurrently, but can be invoked
+// from any of the worker threads. Throwing from a callback stops
+// the render and the exception is rethrown by render()
+typedef std::function<void(const RasterTile &tile)> TileCallback;
+typedef std::function<void(size_t done, size_t total)> ProgressCallback;
+
+void render(const PointSpan &points, const RenderOptions &opts,
+        const TileCallback &onTile = nullptr,
+        const ProgressCallback &onProgress = nullptr);
+
 void render(PointSet *pset, const std::string &outDir, const std::string &outputType,
-        int tileSize, 
-        const std::vector<double> &radiuses, double resolution, 
-        int maxTiles, bool force);
+        int tileSize,
+        const std::vector<double> &radiuses, double resolution,
+        int maxTiles, bool force, int overviewFactor = 0);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,103 @@
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include "renderdem.h"
+#include "render.hpp"
+
+static thread_local std::string lastError;
+
+// True if the caller's rdem_options is recent enough to contain field
+#define RDEM_HAS_OPTION(opts, field) \
+    ((opts)->struct_size >= offsetof(rdem_options, field) + sizeof((opts)->field))
+
+// Sets field only if the caller's struct has room for it
+#define RDEM_SET_OPTION(opts, field, value) \
+    do { if (RDEM_HAS_OPTION(opts, field)) (opts)->field = (value); } while (0)
+
+void rdem_init_options(rdem_options *opts, size_t struct_size){
+    static const double defaultRadius = 0.56;
+
+    if (opts == nullptr || struct_size < sizeof(opts->struct_size)) return;
+    opts->struct_size = (std::min)(struct_size, sizeof(rdem_options));
+
+    RDEM_SET_OPTION(opts, outdir, nullptr);
+    RDEM_SET_OPTION(opts, output_type, "max");
+    RDEM_SET_OPTION(opts, tile_size, 4096);
+    RDEM_SET_OPTION(opts, radiuses, &defaultRadius);
+    RDEM_SET_OPTION(opts, radius_count, 1);
+    RDEM_SET_OPTION(opts, resolution, 0.1);
+    RDEM_SET_OPTION(opts, max_tiles, 0);
+    RDEM_SET_OPTION(opts, force, 0);
+    RDEM_SET_OPTION(opts, verbose, 0);
+    RDEM_SET_OPTION(opts, overview_factor, 0);
+}
+
+int rdem_render(const rdem_points *points, const rdem_options *opts,
+        rdem_tile_callback on_tile, rdem_progress_callback on_progress,
+        void *user_data){
+    try{
+        if (points == nullptr || opts == nullptr) throw std::runtime_error("points and opts are required");
+        if (points->x == nullptr || points->y == nullptr || points->z == nullptr) throw std::runtime_error("x, y and z buffers are required");
+        if (!RDEM_HAS_OPTION(opts, verbose)) throw std::runtime_error("Invalid opts->struct_size (initialize opts with rdem_default_options)");
+        if (opts->radiuses == nullptr || opts->radius_count == 0) throw std::runtime_error("At least one radius is required");
+
+        PointSpan span;
+        span.x = points->x;
+        span.y = points->y;
+        span.z = points->z;
+        span.count = points->count;
+        span.xStride = points->x_stride;
+        span.yStride = points->y_stride;
+        span.zStride = points->z_stride;
+        if (points->srs_wkt != nullptr) span.srs = pdal::SpatialReference(points->srs_wkt);
+
+        RenderOptions ro;
+        if (opts->outdir != nullptr) ro.outDir = opts->outdir;
+        if (opts->output_type != nullptr) ro.outputType = opts->output_type;
+        ro.tileSize = opts->tile_size;
+        ro.radiuses.assign(opts->radiuses, opts->radiuses + opts->radius_count);
+        ro.resolution = opts->resolution;
+        ro.maxTiles = opts->max_tiles;
+        ro.force = opts->force != 0;
+        ro.verbose = opts->verbose != 0;
+        if (RDEM_HAS_OPTION(opts, overview_factor)) ro.overviewFactor = opts->overview_factor;
+
+        TileCallback onTile = nullptr;
+        if (on_tile != nullptr){
+            onTile = [on_tile, user_data](const RasterTile &t){
+                rdem_tile ct;
+                ct.overview = t.overview ? 1 : 0;
+                ct.radius = t.radius;
+                ct.x = t.x;
+                ct.y = t.y;
+                ct.width = t.width;
+                ct.height = t.height;
+                for (int i = 0; i < 6; i++) ct.geotransform[i] = t.geoTransform[i];
+                ct.data = t.data;
+                ct.empty = t.empty ? 1 : 0;
+                ct.filename = t.filename.empty() ? nullptr : t.filename.c_str();
+                on_tile(&ct, user_data);
+            };
+        }
+
+        ProgressCallback onProgress = nullptr;
+        if (on_progress != nullptr){
+            onProgress = [on_progress, user_data](size_t done, size_t total){
+                on_progress(done, total, user_data);
+            };
+        }
+
+        render(span, ro, onTile, onProgress);
+        return 0;
+    }catch(const std::exception &e){
+        lastError = e.what();
+    }catch(...){
+        lastError = "Unknown error";
+    }
+
+    return -1;
+}
+
+const char *rdem_last_error(void){
+    return lastError.c_str();
+}
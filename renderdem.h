@@ -0,0 +1,96 @@
+#ifndef RENDERDEM_H
+#define RENDERDEM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Caller-owned coordinates, never copied. Strides are in bytes;
+   a stride of 0 means tightly packed doubles. */
+typedef struct rdem_points {
+    const double *x;
+    const double *y;
+    const double *z;
+    size_t count;
+    size_t x_stride;
+    size_t y_stride;
+    size_t z_stride;
+
+    /* Optional, may be NULL */
+    const char *srs_wkt;
+} rdem_points;
+
+/* New fields are only ever appended to the structs below, so that
+   callers built against an older header keep working. */
+
+typedef struct rdem_options {
+    /* sizeof(rdem_options) as seen by the caller, set by
+       rdem_default_options. Lets the library tell which fields
+       the caller knows about (and may read or write) */
+    size_t struct_size;
+
+    /* Directory for GeoTIFF tiles, NULL to render in memory only */
+    const char *outdir;
+    /* One of: "max", "idw" */
+    const char *output_type;
+    int tile_size;
+    /* At least one radius is required */
+    const double *radiuses;
+    size_t radius_count;
+    double resolution;
+    int max_tiles;
+    int force;
+    /* Print informational messages to stdout */
+    int verbose;
+
+    /* > 1 to render an overview DEM at overview_factor * resolution first
+       (written to overview/overview.tif in outdir). The factor is raised
+       if needed so that it has at most tile_size * tile_size pixels */
+    int overview_factor;
+} rdem_options;
+
+typedef struct rdem_tile {
+    double radius;
+    unsigned int x;
+    unsigned int y;
+    int width;
+    int height;
+    double geotransform[6];
+
+    /* width * height values (top row first), NaN for no data.
+       Only valid for the duration of the callback */
+    const double *data;
+    int empty;
+
+    /* NULL when rendering in memory only */
+    const char *filename;
+
+    /* Non zero for the overview DEM, which covers the whole extent.
+       Its pixels are not aligned with those of the tiles */
+    int overview;
+} rdem_tile;
+
+/* Callbacks are serialized, but can be invoked from any worker thread */
+typedef void (*rdem_tile_callback)(const rdem_tile *tile, void *user_data);
+typedef void (*rdem_progress_callback)(size_t done, size_t total, void *user_data);
+
+/* Always start from the defaults, this also sets struct_size.
+   Only the first struct_size bytes of opts are written */
+void rdem_init_options(rdem_options *opts, size_t struct_size);
+#define rdem_default_options(opts) rdem_init_options((opts), sizeof(*(opts)))
+
+/* Returns 0 on success, -1 on failure (see rdem_last_error) */
+int rdem_render(const rdem_points *points, const rdem_options *opts,
+        rdem_tile_callback on_tile, rdem_progress_callback on_progress,
+        void *user_data);
+
+/* Message of the last failure on the calling thread */
+const char *rdem_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif